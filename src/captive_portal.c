@@ -4,8 +4,11 @@
 #include "esp_netif.h"
 #include "esp_spiffs.h"
 #include "esp_http_server.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
 #include "lwip/sockets.h"
 #include <string.h>
+#include <errno.h>
 #include <sys/stat.h>
 #include <dirent.h>
 
@@ -36,12 +39,47 @@ static const mime_type_t mime_types[] = {
 
 // Структура пользовательского обработчика
 typedef struct custom_handler {
-    char uri[64];
+    char uri[CAPTIVE_PORTAL_HANDLER_URI_LEN];
     captive_handler_method_t method;
     captive_handler_t handler;
     struct custom_handler *next;
 } custom_handler_t;
 
+// Корзина токенов одного клиента (токены в тысячных долях)
+typedef struct {
+    uint32_t ip;                        // 0 = свободная запись
+    uint32_t last_ms;
+    uint32_t tokens;
+} rate_bucket_t;
+
+// Запись манифеста веб-файлов (tools/build_assets.py)
+typedef struct {
+    char logical[CAPTIVE_PORTAL_ASSET_PATH_LEN];    // имя в исходниках, /styles.css
+    char physical[CAPTIVE_PORTAL_ASSET_PATH_LEN];   // имя в SPIFFS, /styles.1a2b3c4d.css
+} asset_entry_t;
+
+// Класс HTTP соединения
+typedef enum {
+    CONN_NEW,           // запросов ещё не было
+    CONN_PROBE,         // проверка captive portal (generate_204, hotspot-detect...)
+    CONN_PAGE           // страница портала, её файлы и API
+} conn_class_t;
+
+// Открытое соединение httpd (используется только задачей httpd)
+typedef struct {
+    int fd;                             // -1 = свободная запись
+    conn_class_t cls;
+    uint32_t last_ms;                   // время последнего запроса
+} conn_slot_t;
+
+// Таблица корзин. Каждую таблицу использует только одна задача
+// (DNS или httpd), поэтому блокировки не нужны.
+typedef struct {
+    rate_bucket_t buckets[CAPTIVE_PORTAL_RATE_TABLE_SIZE];
+    uint32_t throttled;                 // отклонено запросов
+    uint32_t conn_throttled;            // закрыто соединений при открытии
+} rate_table_t;
+
 // Основная структура портала
 struct captive_portal_t {
     captive_portal_config_t config;
@@ -52,8 +90,54 @@ struct captive_portal_t {
     SemaphoreHandle_t mutex;
     int dns_socket;
     esp_netif_t *ap_netif;
+
+    // Статический режим: память предоставлена вызывающим кодом
+    bool static_alloc;
+    custom_handler_t *free_handlers;    // свободные слоты арены
+    size_t handler_capacity;
+    size_t handler_count;
+    StackType_t *dns_task_stack;
+    StaticTask_t *dns_task_tcb;
+    volatile bool dns_task_done;
+
+    // Быстрый старт и замеры времени запуска
+    bool assets_mounted;
+    bool assets_pending;                // монтирование отложено до первого запроса
+    captive_portal_timing_t timing;
+
+    // Дополнительные заголовки, которые пропускает фильтр
+    char kept_headers[CAPTIVE_PORTAL_MAX_KEPT_HEADERS][CAPTIVE_PORTAL_HEADER_NAME_LEN];
+    size_t kept_header_count;
+    uint32_t header_bytes_dropped;
+    struct hdr_filter *header_filters;  // пул состояний фильтра (статический режим)
+    size_t header_filter_count;
+
+    // Менеджер соединений httpd
+    conn_slot_t conns[CAPTIVE_PORTAL_MAX_SOCKETS];
+    uint32_t conn_evicted[3];           // вытеснено по классам conn_class_t
+    uint32_t conn_idle_closed;
+    uint32_t probe_closed;
+
+    // Ограничение частоты запросов по IP клиента
+    rate_table_t dns_rate;
+    rate_table_t http_rate;
+
+    // Манифест веб-файлов
+    asset_entry_t assets[CAPTIVE_PORTAL_MAX_ASSETS];
+    size_t asset_count;
+
+    // Данные для отчёта о памяти
+    TaskHandle_t httpd_task;
+    size_t httpd_heap_bytes;
+    size_t start_heap_bytes;
 };
 
+// Публичные непрозрачные типы должны вмещать внутренние структуры
+_Static_assert(sizeof(captive_portal_t) <= sizeof(captive_portal_storage_t),
+               "CAPTIVE_PORTAL_STORAGE_WORDS too small");
+_Static_assert(sizeof(custom_handler_t) <= sizeof(captive_handler_slot_t),
+               "captive_handler_slot_t too small");
+
 // ВСПОМОГАТЕЛЬНЫЕ ФУНКЦИИ ИЗ ВАШЕГО КОДА
 static const char *get_mime_type(const char *filename) {
     const char *dot = strrchr(filename, '.');
@@ -86,6 +170,606 @@ static void make_safe_path(char *dest, size_t dest_size, const char *base, const
     }
 }
 
+// Поиск файла в манифесте по логическому или физическому имени (без query)
+static const asset_entry_t *asset_find(captive_portal_t *portal, const char *uri) {
+    size_t len = strcspn(uri, "?");
+
+    for (size_t i = 0; i < portal->asset_count; i++) {
+        const asset_entry_t *asset = &portal->assets[i];
+        if ((strlen(asset->logical) == len && strncmp(asset->logical, uri, len) == 0) ||
+            (strlen(asset->physical) == len && strncmp(asset->physical, uri, len) == 0)) {
+            return asset;
+        }
+    }
+
+    return NULL;
+}
+
+// Имя с хешем содержимого запрошено напрямую - файл никогда не изменится
+static bool asset_is_immutable(const asset_entry_t *asset, const char *uri) {
+    size_t len = strcspn(uri, "?");
+    return strcmp(asset->logical, asset->physical) != 0 &&
+           strlen(asset->physical) == len && strncmp(asset->physical, uri, len) == 0;
+}
+
+// ОГРАНИЧЕНИЕ ЧАСТОТЫ ЗАПРОСОВ (token bucket по IP клиента)
+static bool rate_limit_allow(rate_table_t *table, uint32_t ip,
+                             uint16_t rate, uint16_t burst) {
+    if (!rate) {
+        return true;
+    }
+
+    uint32_t now_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    uint32_t capacity = (uint32_t)(burst ? burst : rate) * 1000;
+    rate_bucket_t *bucket = NULL;
+    rate_bucket_t *oldest = &table->buckets[0];
+
+    for (int i = 0; i < CAPTIVE_PORTAL_RATE_TABLE_SIZE; i++) {
+        rate_bucket_t *b = &table->buckets[i];
+        if (b->ip == ip) {
+            bucket = b;
+            break;
+        }
+        // Свободная запись предпочтительнее самой старой
+        if (oldest->ip && (!b->ip || (int32_t)(b->last_ms - oldest->last_ms) < 0)) {
+            oldest = b;
+        }
+    }
+
+    if (!bucket) {
+        // Новый клиент вытесняет самого давнего
+        bucket = oldest;
+        bucket->ip = ip;
+        bucket->last_ms = now_ms;
+        bucket->tokens = capacity;
+    }
+
+    // Пополнение: rate токенов в секунду = rate тысячных в миллисекунду
+    uint32_t elapsed = now_ms - bucket->last_ms;
+    bucket->last_ms = now_ms;
+    if (elapsed >= capacity / rate) {
+        bucket->tokens = capacity;
+    } else {
+        bucket->tokens += elapsed * rate;
+        if (bucket->tokens > capacity) {
+            bucket->tokens = capacity;
+        }
+    }
+
+    if (bucket->tokens < 1000) {
+        return false;
+    }
+
+    bucket->tokens -= 1000;
+    return true;
+}
+
+// IPv4 адрес клиента HTTP соединения (0 если не удалось определить)
+static uint32_t get_client_ip(int sockfd) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+
+    if (getpeername(sockfd, (struct sockaddr *)&addr, &addr_len) != 0) {
+        return 0;
+    }
+
+    if (addr.ss_family == AF_INET) {
+        return ((struct sockaddr_in *)&addr)->sin_addr.s_addr;
+    }
+#if LWIP_IPV6
+    if (addr.ss_family == AF_INET6) {
+        // IPv4-mapped адрес: последние 4 байта
+        uint32_t ip;
+        memcpy(&ip, &((struct sockaddr_in6 *)&addr)->sin6_addr.s6_addr[12], sizeof(ip));
+        return ip;
+    }
+#endif
+    return 0;
+}
+
+// ФИЛЬТР ЗАГОЛОВКОВ
+// Потоковый сканер на уровне recv: строка запроса и тело передаются
+// как есть, из заголовков остаются только нужные библиотеке и
+// зарегистрированные через captive_portal_keep_header. Благодаря этому
+// длинные заголовки iOS/Android не переполняют CONFIG_HTTPD_MAX_REQ_HDR_LEN.
+// Память это не экономит: буфер заголовков у httpd один на сервер,
+// а состояние фильтра нужно каждому сокету.
+#define HDR_FILTER_RAW_BUF 128
+
+// Заголовки, которые читает сама библиотека или httpd
+static const char *const library_headers[] = {
+    "Host", "User-Agent", "Content-Length", "Content-Type",
+    "Transfer-Encoding", "Connection"
+};
+
+typedef enum {
+    HDR_REQ_LINE,       // строка запроса
+    HDR_LINE_START,     // начало строки заголовка
+    HDR_NAME,           // накопление имени заголовка
+    HDR_EMIT_NAME,      // вывод накопленного имени нужного заголовка
+    HDR_KEEP,           // значение нужного заголовка
+    HDR_DROP,           // значение ненужного заголовка
+    HDR_END,            // \r пустой строки
+    HDR_BODY,           // тело запроса (Content-Length) или данные чанка
+    HDR_CHUNK_SIZE,     // строка размера чанка (hex[;расширения])
+    HDR_CHUNK_DATA_END, // \r\n после данных чанка
+    HDR_CHUNK_TRAILER   // трейлеры после последнего чанка до пустой строки
+} hdr_state_t;
+
+typedef struct hdr_filter {
+    captive_portal_t *portal;
+    bool in_use;                // слот пула занят (статический режим)
+    hdr_state_t state;
+    bool keep_line;             // для строк-продолжений (obs-fold)
+    bool content_length_hdr;
+    bool chunked;
+    bool chunk_ext;             // размер чанка прочитан, дальше расширения
+    bool line_empty;            // в текущей строке трейлера нет символов, кроме \r
+    uint32_t content_length;
+    uint32_t body_left;
+    uint8_t name_len;
+    uint8_t emit_pos;
+    char name[CAPTIVE_PORTAL_HEADER_NAME_LEN + 1];
+    uint8_t raw_pos;
+    uint8_t raw_len;
+    char raw[HDR_FILTER_RAW_BUF];
+} hdr_filter_t;
+
+_Static_assert(sizeof(hdr_filter_t) <= sizeof(captive_header_filter_slot_t),
+               "captive_header_filter_slot_t too small");
+_Static_assert(_Alignof(hdr_filter_t) <= _Alignof(captive_header_filter_slot_t),
+               "captive_header_filter_slot_t misaligned");
+
+static bool hdr_name_is(const hdr_filter_t *f, const char *name) {
+    size_t len = strlen(name);
+    return f->name_len == len && strncasecmp(f->name, name, len) == 0;
+}
+
+static bool hdr_is_kept(const hdr_filter_t *f) {
+    for (int i = 0; i < sizeof(library_headers) / sizeof(library_headers[0]); i++) {
+        if (hdr_name_is(f, library_headers[i])) {
+            return true;
+        }
+    }
+
+    for (size_t i = 0; i < f->portal->kept_header_count; i++) {
+        if (hdr_name_is(f, f->portal->kept_headers[i])) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Конец заголовков: дальше тело или следующий запрос
+static void hdr_headers_done(hdr_filter_t *f) {
+    if (f->chunked) {
+        f->body_left = 0;
+        f->chunk_ext = false;
+        f->state = HDR_CHUNK_SIZE;
+    } else if (f->content_length) {
+        f->body_left = f->content_length;
+        f->state = HDR_BODY;
+    } else {
+        f->state = HDR_REQ_LINE;
+    }
+    f->content_length = 0;
+}
+
+// Прогон накопленных сырых байт через фильтр, возвращает число выведенных байт
+static size_t hdr_filter_run(hdr_filter_t *f, char *out, size_t out_len) {
+    size_t w = 0;
+
+    while (w < out_len) {
+        if (f->state == HDR_EMIT_NAME) {
+            out[w++] = f->name[f->emit_pos++];
+            if (f->emit_pos == f->name_len + 1) {
+                f->state = HDR_KEEP;
+            }
+            continue;
+        }
+
+        if (f->raw_pos == f->raw_len) {
+            break;
+        }
+
+        char c = f->raw[f->raw_pos];
+
+        switch (f->state) {
+        case HDR_LINE_START:
+            if (c == ' ' || c == '\t') {
+                f->state = f->keep_line ? HDR_KEEP : HDR_DROP;
+                continue;
+            }
+            f->raw_pos++;
+            if (c == '\r') {
+                out[w++] = c;
+                f->state = HDR_END;
+            } else if (c == '\n') {
+                out[w++] = c;
+                hdr_headers_done(f);
+            } else {
+                f->name[0] = c;
+                f->name_len = 1;
+                f->state = HDR_NAME;
+            }
+            break;
+
+        case HDR_NAME:
+            f->raw_pos++;
+            if (c == ':') {
+                f->keep_line = hdr_is_kept(f);
+                f->content_length_hdr = hdr_name_is(f, "Content-Length");
+                if (hdr_name_is(f, "Transfer-Encoding")) {
+                    f->chunked = true;
+                }
+                f->name[f->name_len] = ':';
+                f->emit_pos = 0;
+                f->state = f->keep_line ? HDR_EMIT_NAME : HDR_DROP;
+                if (!f->keep_line) {
+                    f->portal->header_bytes_dropped += f->name_len + 1;
+                }
+            } else if (c == '\n') {
+                f->state = HDR_LINE_START;
+            } else if (f->name_len < CAPTIVE_PORTAL_HEADER_NAME_LEN) {
+                f->name[f->name_len++] = c;
+            } else {
+                f->portal->header_bytes_dropped += f->name_len + 1;
+                f->keep_line = false;
+                f->state = HDR_DROP;
+            }
+            break;
+
+        case HDR_KEEP:
+            f->raw_pos++;
+            out[w++] = c;
+            if (f->content_length_hdr && c >= '0' && c <= '9' &&
+                f->content_length < UINT32_MAX / 10) {
+                f->content_length = f->content_length * 10 + (c - '0');
+            }
+            if (c == '\n') {
+                f->state = HDR_LINE_START;
+            }
+            break;
+
+        case HDR_DROP:
+            f->raw_pos++;
+            f->portal->header_bytes_dropped++;
+            if (c == '\n') {
+                f->state = HDR_LINE_START;
+            }
+            break;
+
+        case HDR_END:
+            f->raw_pos++;
+            out[w++] = c;
+            hdr_headers_done(f);
+            break;
+
+        case HDR_BODY:
+            f->raw_pos++;
+            out[w++] = c;
+            if (--f->body_left == 0) {
+                f->state = f->chunked ? HDR_CHUNK_DATA_END : HDR_REQ_LINE;
+            }
+            break;
+
+        // Chunked тело передаётся как есть, фильтр лишь отслеживает его
+        // границы, чтобы найти следующий запрос keep-alive соединения
+        case HDR_CHUNK_SIZE: {
+            f->raw_pos++;
+            out[w++] = c;
+            int digit = c >= '0' && c <= '9' ? c - '0' :
+                        c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+                        c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+            if (c == '\n') {
+                if (f->body_left) {
+                    f->state = HDR_BODY;
+                } else {
+                    f->line_empty = true;
+                    f->state = HDR_CHUNK_TRAILER;
+                }
+            } else if (digit < 0) {
+                f->chunk_ext = true;
+            } else if (!f->chunk_ext && f->body_left < UINT32_MAX / 16) {
+                f->body_left = f->body_left * 16 + digit;
+            }
+            break;
+        }
+
+        case HDR_CHUNK_DATA_END:
+            f->raw_pos++;
+            out[w++] = c;
+            if (c == '\n') {
+                f->chunk_ext = false;
+                f->state = HDR_CHUNK_SIZE;
+            }
+            break;
+
+        case HDR_CHUNK_TRAILER:
+            f->raw_pos++;
+            out[w++] = c;
+            if (c == '\n') {
+                if (f->line_empty) {
+                    f->chunked = false;
+                    f->state = HDR_REQ_LINE;
+                }
+                f->line_empty = true;
+            } else if (c != '\r') {
+                f->line_empty = false;
+            }
+            break;
+
+        case HDR_REQ_LINE:
+            f->raw_pos++;
+            out[w++] = c;
+            if (c == '\n') {
+                f->keep_line = false;
+                f->chunked = false;
+                f->state = HDR_LINE_START;
+            }
+            break;
+
+        default:
+            f->raw_pos++;
+            out[w++] = c;
+            break;
+        }
+    }
+
+    return w;
+}
+
+static int hdr_filter_recv(httpd_handle_t hd, int sockfd, char *buf, size_t buf_len, int flags) {
+    hdr_filter_t *f = httpd_sess_get_transport_ctx(hd, sockfd);
+
+    while (true) {
+        size_t n = f ? hdr_filter_run(f, buf, buf_len) : 0;
+        if (n > 0 || buf_len == 0) {
+            return n;
+        }
+
+        // Сырые данные закончились - читаем из сокета
+        int ret = f ? recv(sockfd, f->raw, sizeof(f->raw), flags) :
+                      recv(sockfd, buf, buf_len, flags);
+        if (ret < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                return HTTPD_SOCK_ERR_TIMEOUT;
+            }
+            return HTTPD_SOCK_ERR_FAIL;
+        }
+        if (ret == 0 || !f) {
+            return ret;
+        }
+        f->raw_pos = 0;
+        f->raw_len = ret;
+    }
+}
+
+// Данные, уже прочитанные из сокета, но ещё не отданные httpd
+static int hdr_filter_pending(httpd_handle_t hd, int sockfd) {
+    hdr_filter_t *f = httpd_sess_get_transport_ctx(hd, sockfd);
+    if (!f) {
+        return 0;
+    }
+
+    int pending = f->raw_len - f->raw_pos;
+    if (f->state == HDR_EMIT_NAME) {
+        pending += f->name_len + 1 - f->emit_pos;
+    }
+    return pending;
+}
+
+// МЕНЕДЖЕР СОЕДИНЕНИЙ
+// Вместо LRU httpd выбирает, какое соединение закрыть: проверки
+// captive portal закрываются сразу после ответа, страница портала
+// получает зарезервированные сокеты и короткий keep-alive.
+static conn_slot_t *conn_find(captive_portal_t *portal, int fd) {
+    for (int i = 0; i < CAPTIVE_PORTAL_MAX_SOCKETS; i++) {
+        if (portal->conns[i].fd == fd) {
+            return &portal->conns[i];
+        }
+    }
+    return NULL;
+}
+
+static void conn_reset(captive_portal_t *portal) {
+    for (int i = 0; i < CAPTIVE_PORTAL_MAX_SOCKETS; i++) {
+        portal->conns[i].fd = -1;
+    }
+}
+
+// Самое давнее соединение, кроме exclude_fd. only_non_page - не трогать страницы.
+static conn_slot_t *conn_lru(captive_portal_t *portal, int exclude_fd, bool only_non_page) {
+    conn_slot_t *victim = NULL;
+    for (int i = 0; i < CAPTIVE_PORTAL_MAX_SOCKETS; i++) {
+        conn_slot_t *c = &portal->conns[i];
+        if (c->fd < 0 || c->fd == exclude_fd || (only_non_page && c->cls == CONN_PAGE)) {
+            continue;
+        }
+        if (!victim || (int32_t)(c->last_ms - victim->last_ms) < 0) {
+            victim = c;
+        }
+    }
+    return victim;
+}
+
+static void conn_close(httpd_handle_t hd, conn_slot_t *c) {
+    ESP_LOGD(TAG, "Closing socket %d (class %d)", c->fd, c->cls);
+    httpd_sess_trigger_close(hd, c->fd);
+    // Запись освободится в portal_sess_close; до этого её не выбираем повторно
+    c->fd = -c->fd - 2;
+}
+
+// Отметка запроса: класс соединения и время активности
+static conn_slot_t *conn_mark(captive_portal_t *portal, httpd_req_t *req, conn_class_t cls) {
+    conn_slot_t *c = conn_find(portal, httpd_req_to_sockfd(req));
+    if (c) {
+        c->cls = cls;
+        c->last_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    }
+    return c;
+}
+
+// Конец ответа: простой keep-alive отсчитывается от него, а не от начала запроса
+static void conn_touch(captive_portal_t *portal, httpd_req_t *req) {
+    conn_slot_t *c = conn_find(portal, httpd_req_to_sockfd(req));
+    if (c) {
+        c->last_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    }
+}
+
+// Политика при открытии соединения new_fd
+static void conn_apply_policy(captive_portal_t *portal, httpd_handle_t hd, int new_fd) {
+    uint32_t now_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    int open = 0;
+    int non_page = 0;
+
+    // Закрываем страницы, простаивающие дольше keep-alive
+    for (int i = 0; i < CAPTIVE_PORTAL_MAX_SOCKETS; i++) {
+        conn_slot_t *c = &portal->conns[i];
+        if (c->fd < 0 || c->fd == new_fd) {
+            continue;
+        }
+        if (c->cls == CONN_PAGE &&
+            now_ms - c->last_ms > portal->config.http_keepalive_idle_ms) {
+            conn_close(hd, c);
+            portal->conn_idle_closed++;
+            continue;
+        }
+        open++;
+        if (c->cls != CONN_PAGE) {
+            non_page++;
+        }
+    }
+    open++;
+    non_page++;
+
+    // Новое соединение ещё без класса: не даём непрошенным занять резерв страниц
+    int non_page_limit = portal->config.max_open_sockets - portal->config.http_page_sockets;
+    if (non_page > non_page_limit) {
+        conn_slot_t *victim = conn_lru(portal, new_fd, true);
+        if (victim) {
+            portal->conn_evicted[victim->cls]++;
+            conn_close(hd, victim);
+            open--;
+        }
+    }
+
+    // Держим один сокет свободным, чтобы httpd не применял свой LRU
+    if (open >= portal->config.max_open_sockets) {
+        conn_slot_t *victim = conn_lru(portal, new_fd, true);
+        if (!victim) {
+            victim = conn_lru(portal, new_fd, false);
+        }
+        if (victim) {
+            portal->conn_evicted[victim->cls]++;
+            conn_close(hd, victim);
+        }
+    }
+}
+
+// Слот пула освобождается в portal_sess_close; httpd не должен вызывать free()
+static void hdr_filter_pool_free(void *ctx) {
+    (void)ctx;
+}
+
+// Новая сессия httpd: учёт соединения и фильтр заголовков
+static esp_err_t portal_sess_open(httpd_handle_t hd, int sockfd) {
+    captive_portal_t *portal = httpd_get_global_user_ctx(hd);
+
+    // Новое соединение тоже расходует токен: клиент, открывающий сокеты
+    // без запросов, закрывается сразу и не занимает все слоты httpd
+    if (portal->config.http_rate_limit) {
+        uint32_t ip = get_client_ip(sockfd);
+        if (ip && !rate_limit_allow(&portal->http_rate, ip,
+                                    portal->config.http_rate_limit,
+                                    portal->config.http_rate_burst)) {
+            portal->http_rate.conn_throttled++;
+            return ESP_FAIL;
+        }
+    }
+
+    // Без учёта соединений conn_mark/conn_touch ничего не делают
+    if (!portal->config.http_lru_only) {
+        conn_slot_t *slot = conn_find(portal, -1);
+        if (slot) {
+            slot->fd = sockfd;
+            slot->cls = CONN_NEW;
+            slot->last_ms = (uint32_t)(esp_timer_get_time() / 1000);
+        }
+        conn_apply_policy(portal, hd, sockfd);
+    }
+
+    if (portal->config.keep_all_headers) {
+        return ESP_OK;
+    }
+
+    // В статическом режиме состояние берётся из пула, иначе из кучи
+    hdr_filter_t *f = NULL;
+    if (portal->static_alloc) {
+        for (size_t i = 0; i < portal->header_filter_count; i++) {
+            if (!portal->header_filters[i].in_use) {
+                f = &portal->header_filters[i];
+                memset(f, 0, sizeof(*f));
+                f->in_use = true;
+                break;
+            }
+        }
+    } else {
+        f = calloc(1, sizeof(hdr_filter_t));
+    }
+    if (!f) {
+        ESP_LOGW(TAG, "No memory for header filter, socket %d", sockfd);
+        return ESP_ERR_NO_MEM;
+    }
+
+    f->portal = portal;
+    f->state = HDR_REQ_LINE;
+    httpd_sess_set_transport_ctx(hd, sockfd, f,
+                                 portal->static_alloc ? hdr_filter_pool_free : free);
+    httpd_sess_set_recv_override(hd, sockfd, hdr_filter_recv);
+    httpd_sess_set_pending_override(hd, sockfd, hdr_filter_pending);
+    return ESP_OK;
+}
+
+// Закрытие сессии httpd. При заданном close_fn сокет закрывает он.
+static void portal_sess_close(httpd_handle_t hd, int sockfd) {
+    captive_portal_t *portal = httpd_get_global_user_ctx(hd);
+
+    conn_slot_t *slot = conn_find(portal, sockfd);
+    if (!slot) {
+        slot = conn_find(portal, -sockfd - 2);
+    }
+    if (slot) {
+        slot->fd = -1;
+    }
+
+    if (portal->static_alloc) {
+        hdr_filter_t *f = httpd_sess_get_transport_ctx(hd, sockfd);
+        if (f) {
+            f->in_use = false;
+        }
+    }
+
+    close(sockfd);
+}
+
+// Портал освобождается в captive_portal_destroy, а не в httpd_stop
+static void portal_global_ctx_free(void *ctx) {
+    (void)ctx;
+}
+
+// Завершение DNS задачи: сигнал и ожидание удаления из captive_portal_stop.
+// Задача не удаляет себя сама - иначе до очистки idle задачей её TCB и стек
+// в статическом режиме ещё заняты, и повторный xTaskCreateStatic их испортит.
+static void dns_task_park(captive_portal_t *portal) {
+    portal->dns_task_done = true;
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+}
+
 // DNS HIJACK ИЗ ВАШЕГО КОДА
 static void dns_hijack_task(void *pvParameters) {
     captive_portal_t *portal = (captive_portal_t *)pvParameters;
@@ -96,8 +780,7 @@ static void dns_hijack_task(void *pvParameters) {
     portal->dns_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
     if (portal->dns_socket < 0) {
         ESP_LOGE(TAG, "Failed to create DNS socket");
-        vTaskDelete(NULL);
-        return;
+        dns_task_park(portal);
     }
     
     server_addr.sin_family = AF_INET;
@@ -108,8 +791,7 @@ static void dns_hijack_task(void *pvParameters) {
              sizeof(server_addr)) < 0) {
         ESP_LOGE(TAG, "Failed to bind DNS socket");
         close(portal->dns_socket);
-        vTaskDelete(NULL);
-        return;
+        dns_task_park(portal);
     }
     
     struct timeval timeout = { .tv_sec = 1, .tv_usec = 0 };
@@ -123,6 +805,14 @@ static void dns_hijack_task(void *pvParameters) {
                           (struct sockaddr *)&client_addr, &addr_len);
         
         if (len > 12) {
+            // Превышение лимита - запрос просто отбрасывается
+            if (!rate_limit_allow(&portal->dns_rate, client_addr.sin_addr.s_addr,
+                                  portal->config.dns_rate_limit,
+                                  portal->config.dns_rate_burst)) {
+                portal->dns_rate.throttled++;
+                continue;
+            }
+
             ESP_LOGI(TAG, "DNS query from %s", inet_ntoa(client_addr.sin_addr));
             
             buffer[2] = 0x81;
@@ -148,14 +838,20 @@ static void dns_hijack_task(void *pvParameters) {
             
             sendto(portal->dns_socket, buffer, len + 16, 0,
                    (struct sockaddr *)&client_addr, addr_len);
+
+            if (!portal->timing.first_dns_us) {
+                portal->timing.first_dns_us = esp_timer_get_time();
+            }
         }
     }
     
     close(portal->dns_socket);
     ESP_LOGI(TAG, "DNS hijack stopped");
-    vTaskDelete(NULL);
+    dns_task_park(portal);
 }
 
+static void mount_assets(captive_portal_t *portal, bool format_if_mount_failed);
+
 // ОБРАБОТЧИК СТАТИЧЕСКИХ ФАЙЛОВ ИЗ ВАШЕГО КОДА
 static esp_err_t static_file_handler(httpd_req_t *req) {
     captive_portal_t *portal = (captive_portal_t *)req->user_ctx;
@@ -163,10 +859,20 @@ static esp_err_t static_file_handler(httpd_req_t *req) {
     FILE *file = NULL;
     esp_err_t ret = ESP_OK;
 
-    if (strcmp(req->uri, "/") == 0) {
-        make_safe_path(filepath, sizeof(filepath), portal->config.web_root_path, "/index.html");
+    // Быстрый старт: хранилище монтируется при первом запросе файла.
+    // Форматирование здесь не выполняется - оно заняло бы секунды.
+    if (portal->assets_pending) {
+        int64_t mount_start = esp_timer_get_time();
+        mount_assets(portal, false);
+        portal->timing.spiffs_us = esp_timer_get_time() - mount_start;
+    }
+
+    const char *uri = strcmp(req->uri, "/") == 0 ? "/index.html" : req->uri;
+    const asset_entry_t *asset = asset_find(portal, uri);
+    if (asset) {
+        make_safe_path(filepath, sizeof(filepath), portal->config.web_root_path, asset->physical);
     } else {
-        make_safe_path(filepath, sizeof(filepath), portal->config.web_root_path, req->uri);
+        make_safe_path(filepath, sizeof(filepath), portal->config.web_root_path, uri);
     }
 
     struct stat st;
@@ -186,6 +892,12 @@ static esp_err_t static_file_handler(httpd_req_t *req) {
     const char *mime_type = get_mime_type(filepath);
     httpd_resp_set_type(req, mime_type);
 
+    // Файлы с хешем в имени кешируются навсегда, остальные из манифеста - с проверкой
+    if (asset) {
+        httpd_resp_set_hdr(req, "Cache-Control", asset_is_immutable(asset, uri) ?
+                           "public, max-age=31536000, immutable" : "no-cache");
+    }
+
     ESP_LOGI(TAG, "Serving file: %s (%ld bytes)", req->uri, (long)st.st_size);
 
     char buffer[512];
@@ -312,15 +1024,37 @@ static esp_err_t captive_simple_handler(httpd_req_t *req) {
 // WILDCARD HANDLER ИЗ ВАШЕГО КОДА (с добавлением пользовательских обработчиков)
 static esp_err_t wildcard_handler(httpd_req_t *req) {
     captive_portal_t *portal = (captive_portal_t *)req->user_ctx;
+
+    // Превышение лимита - 429 и закрытие соединения (ESP_FAIL)
+    if (portal->config.http_rate_limit) {
+        uint32_t ip = get_client_ip(httpd_req_to_sockfd(req));
+        if (ip && !rate_limit_allow(&portal->http_rate, ip,
+                                    portal->config.http_rate_limit,
+                                    portal->config.http_rate_burst)) {
+            portal->http_rate.throttled++;
+            httpd_resp_set_status(req, "429 Too Many Requests");
+            httpd_resp_set_hdr(req, "Retry-After", "1");
+            httpd_resp_set_hdr(req, "Connection", "close");
+            httpd_resp_send(req, NULL, 0);
+            return ESP_FAIL;
+        }
+    }
     
     ESP_LOGI(TAG, "Wildcard handler: %s", req->uri);
 
-    // Быстрая проверка на стандартные файлы
+    // Запоминаем задачу httpd для отчёта о стеке
+    if (!portal->httpd_task) {
+        portal->httpd_task = xTaskGetCurrentTaskHandle();
+    }
+
+    // Быстрая проверка на стандартные файлы и файлы из манифеста
     if (strcmp(req->uri, "/") == 0 ||
         strcmp(req->uri, "/index.html") == 0 ||
-        strcmp(req->uri, "/styles.css") == 0 ||
-        strcmp(req->uri, "/script.js") == 0) {
-        return static_file_handler(req);
+        asset_find(portal, req->uri)) {
+        conn_mark(portal, req, CONN_PAGE);
+        esp_err_t ret = static_file_handler(req);
+        conn_touch(portal, req);
+        return ret;
     }
 
     // Проверяем пользовательские обработчики ПЕРВЫМИ
@@ -339,7 +1073,10 @@ static esp_err_t wildcard_handler(httpd_req_t *req) {
                 if (portal->mutex) {
                     xSemaphoreGive(portal->mutex);
                 }
-                return handler->handler(req);
+                conn_mark(portal, req, CONN_PAGE);
+                esp_err_t ret = handler->handler(req);
+                conn_touch(portal, req);
+                return ret;
             }
         }
         handler = handler->next;
@@ -361,23 +1098,48 @@ static esp_err_t wildcard_handler(httpd_req_t *req) {
 
     for (int i = 0; i < sizeof(captive_keywords) / sizeof(captive_keywords[0]); i++) {
         if (strstr(req->uri, captive_keywords[i])) {
-            return captive_simple_handler(req);
+            // Ответ на проверку - соединение сразу закрывается.
+            // Слот переходит в состояние закрытия, чтобы политика
+            // не выбрала его жертвой повторно.
+            bool close_conn = !portal->config.http_lru_only;
+            conn_slot_t *slot = conn_mark(portal, req, CONN_PROBE);
+            if (close_conn) {
+                httpd_resp_set_hdr(req, "Connection", "close");
+            }
+            esp_err_t ret = captive_simple_handler(req);
+
+            // Время первого ответа на проверку - после отправки ответа
+            if (ret == ESP_OK && !portal->timing.first_probe_us) {
+                portal->timing.first_probe_us = esp_timer_get_time();
+            }
+            if (close_conn) {
+                if (slot) {
+                    conn_close(req->handle, slot);
+                } else {
+                    httpd_sess_trigger_close(req->handle, httpd_req_to_sockfd(req));
+                }
+                portal->probe_closed++;
+            }
+            return ret;
         }
     }
 
     // Если не нашли - пробуем как статический файл
-    return static_file_handler(req);
+    conn_mark(portal, req, CONN_PAGE);
+    esp_err_t ret = static_file_handler(req);
+    conn_touch(portal, req);
+    return ret;
 }
 
 // Инициализация SPIFFS
-static esp_err_t init_spiffs(const char *base_path) {
+static esp_err_t init_spiffs(const char *base_path, bool format_if_mount_failed) {
     ESP_LOGI(TAG, "Initializing SPIFFS");
 
     esp_vfs_spiffs_conf_t conf = {
         .base_path = base_path,
         .partition_label = NULL,
         .max_files = 10,
-        .format_if_mount_failed = true
+        .format_if_mount_failed = format_if_mount_failed
     };
 
     esp_err_t ret = esp_vfs_spiffs_register(&conf);
@@ -393,15 +1155,78 @@ static esp_err_t init_spiffs(const char *base_path) {
     return ESP_OK;
 }
 
-// Инициализация портала
-captive_portal_t* captive_portal_init(const captive_portal_config_t *config) {
-    captive_portal_t *portal = calloc(1, sizeof(captive_portal_t));
-    if (!portal) {
-        ESP_LOGE(TAG, "Failed to allocate portal");
-        return NULL;
+// Загрузка манифеста веб-файлов, если он есть в хранилище.
+// Формат: строка "логическое_имя физическое_имя", # - комментарий.
+static void load_asset_manifest(captive_portal_t *portal) {
+    char path[64];
+    make_safe_path(path, sizeof(path), portal->config.web_root_path, "/asset-manifest.txt");
+
+    portal->asset_count = 0;
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        ESP_LOGI(TAG, "No asset manifest, serving files by name");
+        return;
+    }
+
+    char line[2 * CAPTIVE_PORTAL_ASSET_PATH_LEN + 8];
+    while (fgets(line, sizeof(line), file)) {
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r') {
+            continue;
+        }
+
+        if (portal->asset_count >= CAPTIVE_PORTAL_MAX_ASSETS) {
+            ESP_LOGW(TAG, "Asset manifest has more than %d entries, rest ignored",
+                     CAPTIVE_PORTAL_MAX_ASSETS);
+            break;
+        }
+
+        // Слишком длинная строка: дочитываем остаток и пропускаем запись
+        if (!strchr(line, '\n') && !feof(file)) {
+            int c;
+            while ((c = fgetc(file)) != EOF && c != '\n') {
+            }
+            ESP_LOGW(TAG, "Asset manifest line too long, skipped");
+            continue;
+        }
+
+        // Буферы размером со строку: %s не может их переполнить
+        char logical[sizeof(line)];
+        char physical[sizeof(line)];
+        if (sscanf(line, "%s %s", logical, physical) != 2) {
+            continue;
+        }
+        if (strlen(logical) >= CAPTIVE_PORTAL_ASSET_PATH_LEN ||
+            strlen(physical) >= CAPTIVE_PORTAL_ASSET_PATH_LEN) {
+            ESP_LOGW(TAG, "Asset name too long, skipped: %s", logical);
+            continue;
+        }
+
+        asset_entry_t *asset = &portal->assets[portal->asset_count++];
+        strcpy(asset->logical, logical);
+        strcpy(asset->physical, physical);
+    }
+
+    fclose(file);
+    ESP_LOGI(TAG, "Asset manifest: %zu entries", portal->asset_count);
+}
+
+// Монтирование хранилища веб-файлов (один раз за время жизни портала)
+static void mount_assets(captive_portal_t *portal, bool format_if_mount_failed) {
+    portal->assets_pending = false;
+    if (portal->assets_mounted) {
+        return;
     }
 
-    // Копируем конфигурацию
+    if (init_spiffs(portal->config.web_root_path, format_if_mount_failed) == ESP_OK) {
+        portal->assets_mounted = true;
+        load_asset_manifest(portal);
+    } else {
+        ESP_LOGW(TAG, "SPIFFS not available, using minimal web interface");
+    }
+}
+
+// Конфигурация и значения по умолчанию
+static void portal_apply_config(captive_portal_t *portal, const captive_portal_config_t *config) {
     if (config) {
         memcpy(&portal->config, config, sizeof(captive_portal_config_t));
     } else {
@@ -414,6 +1239,45 @@ captive_portal_t* captive_portal_init(const captive_portal_config_t *config) {
         strcpy(portal->config.web_root_path, "/spiffs");
     }
 
+    if (!portal->config.dns_task_stack_size) {
+        portal->config.dns_task_stack_size = CAPTIVE_PORTAL_DNS_STACK_SIZE;
+    }
+    if (portal->config.dns_task_stack_size < CAPTIVE_PORTAL_DNS_STACK_MIN) {
+        portal->config.dns_task_stack_size = CAPTIVE_PORTAL_DNS_STACK_MIN;
+    }
+    if (!portal->config.httpd_stack_size) {
+        portal->config.httpd_stack_size = 4096;
+    }
+    if (!portal->config.max_open_sockets) {
+        portal->config.max_open_sockets = 7;
+    }
+    if (portal->config.max_open_sockets > CAPTIVE_PORTAL_MAX_SOCKETS) {
+        portal->config.max_open_sockets = CAPTIVE_PORTAL_MAX_SOCKETS;
+    }
+    if (!portal->config.http_timeout_s) {
+        portal->config.http_timeout_s = 5;
+    }
+    if (!portal->config.http_page_sockets) {
+        portal->config.http_page_sockets = 2;
+    }
+    if (portal->config.http_page_sockets >= portal->config.max_open_sockets) {
+        portal->config.http_page_sockets = portal->config.max_open_sockets - 1;
+    }
+    if (!portal->config.http_keepalive_idle_ms) {
+        portal->config.http_keepalive_idle_ms = 2000;
+    }
+}
+
+// Инициализация портала
+captive_portal_t* captive_portal_init(const captive_portal_config_t *config) {
+    captive_portal_t *portal = calloc(1, sizeof(captive_portal_t));
+    if (!portal) {
+        ESP_LOGE(TAG, "Failed to allocate portal");
+        return NULL;
+    }
+
+    portal_apply_config(portal, config);
+
     portal->mutex = xSemaphoreCreateMutex();
     if (!portal->mutex) {
         ESP_LOGW(TAG, "Failed to create mutex, continuing without it");
@@ -423,52 +1287,105 @@ captive_portal_t* captive_portal_init(const captive_portal_config_t *config) {
     return portal;
 }
 
-// Запуск портала (настройка сети как в вашем коде)
-esp_err_t captive_portal_start(captive_portal_t *portal) {
-    if (!portal || portal->running) {
-        return ESP_FAIL;
+// Инициализация в статическом режиме (вся память от вызывающего кода)
+captive_portal_t* captive_portal_init_static(const captive_portal_config_t *config,
+                                             const captive_portal_static_storage_t *storage) {
+    if (!storage || !storage->portal || !storage->dns_task_stack ||
+        !storage->dns_task_tcb || !storage->mutex_buffer ||
+        (storage->handler_slot_count && !storage->handler_slots)) {
+        ESP_LOGE(TAG, "Invalid static storage");
+        return NULL;
+    }
+    if (storage->dns_task_stack_size < CAPTIVE_PORTAL_DNS_STACK_MIN) {
+        ESP_LOGE(TAG, "DNS task stack too small: %lu < %d bytes",
+                 (unsigned long)storage->dns_task_stack_size, CAPTIVE_PORTAL_DNS_STACK_MIN);
+        return NULL;
     }
 
-    // Инициализируем SPIFFS
-    if (init_spiffs(portal->config.web_root_path) != ESP_OK) {
-        ESP_LOGW(TAG, "SPIFFS not available, using minimal web interface");
+    captive_portal_t *portal = (captive_portal_t *)storage->portal;
+    memset(portal, 0, sizeof(captive_portal_t));
+
+    portal_apply_config(portal, config);
+
+    // Размер стека определяется буфером вызывающего кода
+    portal->static_alloc = true;
+    portal->dns_task_stack = storage->dns_task_stack;
+    portal->dns_task_tcb = storage->dns_task_tcb;
+    portal->config.dns_task_stack_size = storage->dns_task_stack_size;
+
+    // Собираем арену обработчиков в список свободных слотов
+    custom_handler_t *slots = (custom_handler_t *)storage->handler_slots;
+    for (size_t i = 0; i < storage->handler_slot_count; i++) {
+        slots[i].next = portal->free_handlers;
+        portal->free_handlers = &slots[i];
     }
+    portal->handler_capacity = storage->handler_slot_count;
 
-    // Создаем сетевой интерфейс
-    portal->ap_netif = esp_netif_create_default_wifi_ap();
-    if (!portal->ap_netif) {
-        ESP_LOGE(TAG, "Failed to create AP network interface");
+    // Пул фильтра заголовков: по слоту на каждый сокет httpd
+    if (!portal->config.keep_all_headers &&
+        (!storage->header_filter_slots ||
+         storage->header_filter_slot_count < portal->config.max_open_sockets)) {
+        ESP_LOGE(TAG, "Need %u header filter slots", portal->config.max_open_sockets);
+        return NULL;
+    }
+    portal->header_filters = (hdr_filter_t *)storage->header_filter_slots;
+    portal->header_filter_count = storage->header_filter_slot_count;
+
+    portal->mutex = xSemaphoreCreateMutexStatic(storage->mutex_buffer);
+
+    ESP_LOGI(TAG, "Captive portal initialized (static, %zu handler slots)",
+             portal->handler_capacity);
+    return portal;
+}
+
+// Запуск DNS hijack задачи
+static esp_err_t start_dns_task(captive_portal_t *portal) {
+    portal->dns_task_done = false;
+    if (portal->static_alloc) {
+        portal->dns_task = xTaskCreateStatic(dns_hijack_task, "dns_hijack",
+                                             portal->config.dns_task_stack_size, portal, 5,
+                                             portal->dns_task_stack, portal->dns_task_tcb);
+    } else if (xTaskCreate(dns_hijack_task, "dns_hijack", portal->config.dns_task_stack_size,
+                           portal, 5, &portal->dns_task) != pdPASS) {
+        portal->dns_task = NULL;
+    }
+    if (!portal->dns_task) {
+        ESP_LOGE(TAG, "Failed to start DNS task");
+        portal->dns_task_done = true;
         return ESP_FAIL;
     }
+    return ESP_OK;
+}
 
-    // Настраиваем IP адрес
-    esp_netif_ip_info_t ip_info;
-    IP4_ADDR(&ip_info.ip, 192, 168, 4, 1);
-    IP4_ADDR(&ip_info.gw, 192, 168, 4, 1);
-    IP4_ADDR(&ip_info.netmask, 255, 255, 255, 0);
-    esp_netif_dhcps_stop(portal->ap_netif);
-    esp_netif_set_ip_info(portal->ap_netif, &ip_info);
-    esp_netif_dhcps_start(portal->ap_netif);
+// Удаление DNS задачи, если она уже подала сигнал завершения
+static bool reap_dns_task(captive_portal_t *portal) {
+    if (!portal->dns_task) {
+        return true;
+    }
+    if (!portal->dns_task_done) {
+        return false;
+    }
 
-    // Настраиваем WiFi (как в вашем коде)
-    wifi_config_t wifi_config = {0};
-    strcpy((char *)wifi_config.ap.ssid, portal->config.ap_ssid);
-    wifi_config.ap.ssid_len = strlen(portal->config.ap_ssid);
-    wifi_config.ap.channel = portal->config.ap_channel;
-    wifi_config.ap.authmode = portal->config.ap_password[0] ? 
-                             WIFI_AUTH_WPA_WPA2_PSK : WIFI_AUTH_OPEN;
-    wifi_config.ap.ssid_hidden = portal->config.ap_hidden;
-    wifi_config.ap.max_connection = 4;
-    wifi_config.ap.beacon_interval = 100;
-    
-    if (portal->config.ap_password[0]) {
-        strcpy((char *)wifi_config.ap.password, portal->config.ap_password);
+    vTaskDelete(portal->dns_task);
+    portal->dns_task = NULL;
+    return true;
+}
+
+// Ожидание завершения DNS задачи (таймаут recvfrom 1 с), чтобы стек
+// в статическом режиме можно было использовать повторно
+static void wait_dns_task_stopped(captive_portal_t *portal) {
+    for (int i = 0; i < 20 && portal->dns_task && !portal->dns_task_done; i++) {
+        vTaskDelay(100 / portTICK_PERIOD_MS);
     }
 
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_AP));
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_AP, &wifi_config));
-    ESP_ERROR_CHECK(esp_wifi_start());
+    // Задача не ответила - handle сохраняется, повторный запуск будет отклонён
+    if (!reap_dns_task(portal)) {
+        ESP_LOGE(TAG, "DNS task did not stop");
+    }
+}
 
+// Запуск HTTP сервера и регистрация wildcard обработчиков
+static esp_err_t start_http_server(captive_portal_t *portal) {
     // Конфигурация HTTP сервера (как в вашем коде)
     httpd_config_t server_config = HTTPD_DEFAULT_CONFIG();
     server_config.server_port = portal->config.http_port;
@@ -477,26 +1394,41 @@ esp_err_t captive_portal_start(captive_portal_t *portal) {
     server_config.uri_match_fn = httpd_uri_match_wildcard;
     
     // УВЕЛИЧЬТЕ ЭТИ НАСТРОЙКИ:
-    server_config.max_open_sockets = 7;
-    server_config.recv_wait_timeout = 5;
-    server_config.send_wait_timeout = 5;
-    server_config.stack_size = 4096;
+    server_config.max_open_sockets = portal->config.max_open_sockets;
+    server_config.recv_wait_timeout = portal->config.http_timeout_s;
+    server_config.send_wait_timeout = portal->config.http_timeout_s;
+    server_config.stack_size = portal->config.httpd_stack_size;
+
+    // Фильтр заголовков подключается к каждой новой сессии
+    server_config.global_user_ctx = portal;
+    server_config.global_user_ctx_free_fn = portal_global_ctx_free;
+    server_config.open_fn = portal_sess_open;
+    server_config.close_fn = portal_sess_close;
+    conn_reset(portal);
+    for (size_t i = 0; i < portal->header_filter_count; i++) {
+        portal->header_filters[i].in_use = false;
+    }
 
     ESP_LOGI(TAG, "Starting web server on port %d", server_config.server_port);
 
-    // Пробуем запустить сервер (как в вашем коде)
+    // Пробуем запустить сервер (как в вашем коде).
+    // При быстром старте пауза между попытками короче.
+    int retry_delay_ms = portal->config.fast_start ? 100 : 1000;
     esp_err_t ret;
     int retry_count = 0;
 
     for (retry_count = 0; retry_count < 3; retry_count++) {
+        size_t heap_before = heap_caps_get_free_size(MALLOC_CAP_8BIT);
         ret = httpd_start(&portal->server, &server_config);
         if (ret == ESP_OK) {
+            size_t heap_after = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+            portal->httpd_heap_bytes = heap_before > heap_after ? heap_before - heap_after : 0;
             break;
         }
 
         ESP_LOGW(TAG, "Failed to start server (attempt %d): %s",
                  retry_count + 1, esp_err_to_name(ret));
-        vTaskDelay(1000 / portTICK_PERIOD_MS);
+        vTaskDelay(retry_delay_ms / portTICK_PERIOD_MS);
     }
 
     if (ret != ESP_OK) {
@@ -533,15 +1465,130 @@ esp_err_t captive_portal_start(captive_portal_t *portal) {
         .user_ctx = portal
     });
 
-    // Запускаем DNS hijack
-    portal->running = true;
-    xTaskCreate(dns_hijack_task, "dns_hijack", 4096, portal, 5, &portal->dns_task);
+    return ESP_OK;
+}
+
+// Запуск портала (настройка сети как в вашем коде)
+esp_err_t captive_portal_start(captive_portal_t *portal) {
+    if (!portal || portal->running) {
+        return ESP_FAIL;
+    }
+
+    // Прошлая DNS задача ещё работает: её стек и TCB нельзя использовать повторно
+    if (!reap_dns_task(portal)) {
+        ESP_LOGE(TAG, "Previous DNS task has not exited, refusing to start");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    size_t heap_before_start = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    captive_portal_timing_t *timing = &portal->timing;
+    memset(timing, 0, sizeof(*timing));
+    timing->start_us = esp_timer_get_time();
+    int64_t phase_start = timing->start_us;
+
+    // Инициализируем SPIFFS (при быстром старте - при первом запросе файла)
+    if (portal->config.fast_start) {
+        portal->assets_pending = !portal->assets_mounted;
+    } else {
+        mount_assets(portal, true);
+        timing->spiffs_us = esp_timer_get_time() - phase_start;
+    }
+
+    // Создаем сетевой интерфейс
+    phase_start = esp_timer_get_time();
+    portal->ap_netif = esp_netif_create_default_wifi_ap();
+    if (!portal->ap_netif) {
+        ESP_LOGE(TAG, "Failed to create AP network interface");
+        return ESP_FAIL;
+    }
+
+    // Настраиваем IP адрес. При быстром старте DHCP сервер
+    // не перезапускается, если адрес по умолчанию уже совпадает.
+    esp_netif_ip_info_t ip_info;
+    IP4_ADDR(&ip_info.ip, 192, 168, 4, 1);
+    IP4_ADDR(&ip_info.gw, 192, 168, 4, 1);
+    IP4_ADDR(&ip_info.netmask, 255, 255, 255, 0);
+
+    esp_netif_ip_info_t current_ip = {0};
+    bool ip_matches = portal->config.fast_start &&
+                      esp_netif_get_ip_info(portal->ap_netif, &current_ip) == ESP_OK &&
+                      current_ip.ip.addr == ip_info.ip.addr &&
+                      current_ip.gw.addr == ip_info.gw.addr &&
+                      current_ip.netmask.addr == ip_info.netmask.addr;
+    if (!ip_matches) {
+        esp_netif_dhcps_stop(portal->ap_netif);
+        esp_netif_set_ip_info(portal->ap_netif, &ip_info);
+        esp_netif_dhcps_start(portal->ap_netif);
+    }
+    timing->netif_us = esp_timer_get_time() - phase_start;
+
+    // Настраиваем WiFi (как в вашем коде)
+    phase_start = esp_timer_get_time();
+    wifi_config_t wifi_config = {0};
+    strcpy((char *)wifi_config.ap.ssid, portal->config.ap_ssid);
+    wifi_config.ap.ssid_len = strlen(portal->config.ap_ssid);
+    wifi_config.ap.channel = portal->config.ap_channel;
+    wifi_config.ap.authmode = portal->config.ap_password[0] ? 
+                             WIFI_AUTH_WPA_WPA2_PSK : WIFI_AUTH_OPEN;
+    wifi_config.ap.ssid_hidden = portal->config.ap_hidden;
+    wifi_config.ap.max_connection = 4;
+    wifi_config.ap.beacon_interval = 100;
+    
+    if (portal->config.ap_password[0]) {
+        strcpy((char *)wifi_config.ap.password, portal->config.ap_password);
+    }
+
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_AP));
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_AP, &wifi_config));
+    ESP_ERROR_CHECK(esp_wifi_start());
+    timing->wifi_us = esp_timer_get_time() - phase_start;
+
+    portal->httpd_task = NULL;
+    esp_err_t ret;
+
+    if (portal->config.fast_start) {
+        // Быстрый старт: DNS отвечает до запуска HTTP сервера
+        portal->running = true;
+        phase_start = esp_timer_get_time();
+        start_dns_task(portal);
+        timing->dns_us = esp_timer_get_time() - phase_start;
+
+        phase_start = esp_timer_get_time();
+        ret = start_http_server(portal);
+        timing->httpd_us = esp_timer_get_time() - phase_start;
+        if (ret != ESP_OK) {
+            portal->running = false;
+            wait_dns_task_stopped(portal);
+            return ret;
+        }
+    } else {
+        phase_start = esp_timer_get_time();
+        ret = start_http_server(portal);
+        timing->httpd_us = esp_timer_get_time() - phase_start;
+        if (ret != ESP_OK) {
+            return ret;
+        }
+
+        // Запускаем DNS hijack
+        portal->running = true;
+        phase_start = esp_timer_get_time();
+        start_dns_task(portal);
+        timing->dns_us = esp_timer_get_time() - phase_start;
+    }
+
+    timing->total_us = esp_timer_get_time() - timing->start_us;
+
+    size_t heap_after_start = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    portal->start_heap_bytes = heap_before_start > heap_after_start ?
+                               heap_before_start - heap_after_start : 0;
 
     ESP_LOGI(TAG, "========================================");
     ESP_LOGI(TAG, "Captive Portal Started!");
     ESP_LOGI(TAG, "WiFi SSID: %s", portal->config.ap_ssid);
     ESP_LOGI(TAG, "IP Address: " IPSTR, IP2STR(&ip_info.ip));
     ESP_LOGI(TAG, "HTTP Port: %d", portal->config.http_port);
+    ESP_LOGI(TAG, "Start time: %lld us%s", (long long)timing->total_us,
+             portal->config.fast_start ? " (fast start)" : "");
     ESP_LOGI(TAG, "========================================");
 
     return ESP_OK;
@@ -573,12 +1620,21 @@ esp_err_t captive_portal_add_handler(captive_portal_t *portal,
         existing = existing->next;
     }
 
-    // Добавляем новый
-    custom_handler_t *new_handler = malloc(sizeof(custom_handler_t));
+    // Добавляем новый (из арены в статическом режиме)
+    custom_handler_t *new_handler;
+    if (portal->static_alloc) {
+        new_handler = portal->free_handlers;
+        if (new_handler) {
+            portal->free_handlers = new_handler->next;
+        }
+    } else {
+        new_handler = malloc(sizeof(custom_handler_t));
+    }
     if (!new_handler) {
         if (portal->mutex) {
             xSemaphoreGive(portal->mutex);
         }
+        ESP_LOGW(TAG, "No memory for handler %s", uri);
         return ESP_ERR_NO_MEM;
     }
 
@@ -588,6 +1644,7 @@ esp_err_t captive_portal_add_handler(captive_portal_t *portal,
     new_handler->handler = handler;
     new_handler->next = portal->custom_handlers;
     portal->custom_handlers = new_handler;
+    portal->handler_count++;
 
     if (portal->mutex) {
         xSemaphoreGive(portal->mutex);
@@ -597,6 +1654,27 @@ esp_err_t captive_portal_add_handler(captive_portal_t *portal,
     return ESP_OK;
 }
 
+// Регистрация заголовка, который должен пройти через фильтр
+esp_err_t captive_portal_keep_header(captive_portal_t *portal, const char *name) {
+    if (!portal || !name || !name[0] || strlen(name) >= CAPTIVE_PORTAL_HEADER_NAME_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Фильтр читает список без блокировки, поэтому менять его можно только до запуска
+    if (portal->running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (portal->kept_header_count >= CAPTIVE_PORTAL_MAX_KEPT_HEADERS) {
+        ESP_LOGW(TAG, "No slot for header %s", name);
+        return ESP_ERR_NO_MEM;
+    }
+
+    strcpy(portal->kept_headers[portal->kept_header_count++], name);
+    ESP_LOGI(TAG, "Keeping header %s", name);
+    return ESP_OK;
+}
+
 // Остановка портала
 esp_err_t captive_portal_stop(captive_portal_t *portal) {
     if (!portal || !portal->running) {
@@ -605,6 +1683,7 @@ esp_err_t captive_portal_stop(captive_portal_t *portal) {
 
     portal->running = false;
     vTaskDelay(100 / portTICK_PERIOD_MS);
+    wait_dns_task_stopped(portal);
 
     if (portal->server) {
         httpd_stop(portal->server);
@@ -630,27 +1709,113 @@ void captive_portal_destroy(captive_portal_t *portal) {
         captive_portal_stop(portal);
     }
 
+    // Зависшая DNS задача удаляется принудительно, иначе она обратится к освобождённой памяти
+    if (!reap_dns_task(portal)) {
+        vTaskDelete(portal->dns_task);
+        close(portal->dns_socket);
+        portal->dns_task = NULL;
+    }
+
     if (portal->mutex) {
         xSemaphoreTake(portal->mutex, portMAX_DELAY);
     }
     
+    // В статическом режиме слоты арены принадлежат вызывающему коду
     custom_handler_t *handler = portal->custom_handlers;
-    while (handler) {
+    while (handler && !portal->static_alloc) {
         custom_handler_t *next = handler->next;
         free(handler);
         handler = next;
     }
+    portal->custom_handlers = NULL;
     
     if (portal->mutex) {
         xSemaphoreGive(portal->mutex);
         vSemaphoreDelete(portal->mutex);
     }
 
-    free(portal);
+    if (!portal->static_alloc) {
+        free(portal);
+    }
     ESP_LOGI(TAG, "Captive portal destroyed");
 }
 
 // Утилиты
 bool captive_portal_is_running(captive_portal_t *portal) {
     return portal ? portal->running : false;
-}
\ No newline at end of file
+}
+
+// Отчёт о потреблении памяти
+esp_err_t captive_portal_get_footprint(captive_portal_t *portal,
+                                       captive_portal_footprint_t *footprint) {
+    if (!portal || !footprint) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(footprint, 0, sizeof(*footprint));
+    footprint->static_alloc = portal->static_alloc;
+    footprint->portal_bytes = sizeof(captive_portal_t);
+
+    if (portal->mutex) {
+        xSemaphoreTake(portal->mutex, portMAX_DELAY);
+    }
+    footprint->handler_count = portal->handler_count;
+    footprint->handler_capacity = portal->handler_capacity;
+    footprint->handler_bytes = sizeof(custom_handler_t) *
+        (portal->static_alloc ? portal->handler_capacity : portal->handler_count);
+    if (portal->mutex) {
+        xSemaphoreGive(portal->mutex);
+    }
+
+    // В ESP-IDF размер стека и high-water mark задаются в байтах
+    footprint->dns_stack_bytes = portal->config.dns_task_stack_size;
+    if (portal->running && portal->dns_task && !portal->dns_task_done) {
+        footprint->dns_stack_free_min = uxTaskGetStackHighWaterMark(portal->dns_task);
+    }
+
+    footprint->httpd_stack_bytes = portal->config.httpd_stack_size;
+    if (portal->running && portal->httpd_task) {
+        footprint->httpd_stack_free_min = uxTaskGetStackHighWaterMark(portal->httpd_task);
+    }
+
+    footprint->httpd_heap_bytes = portal->httpd_heap_bytes;
+    footprint->httpd_open_sockets = portal->config.max_open_sockets;
+    if (!portal->config.keep_all_headers) {
+        footprint->header_filter_bytes = sizeof(hdr_filter_t) * (portal->static_alloc ?
+            portal->header_filter_count : portal->config.max_open_sockets);
+    }
+    footprint->start_heap_bytes = portal->start_heap_bytes;
+
+    return ESP_OK;
+}
+
+// Замеры времени запуска
+esp_err_t captive_portal_get_timing(captive_portal_t *portal,
+                                    captive_portal_timing_t *timing) {
+    if (!portal || !timing) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memcpy(timing, &portal->timing, sizeof(*timing));
+    return ESP_OK;
+}
+
+// Статистика работы портала
+esp_err_t captive_portal_get_stats(captive_portal_t *portal,
+                                   captive_portal_stats_t *stats) {
+    if (!portal || !stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    stats->dns_throttled = portal->dns_rate.throttled;
+    stats->http_throttled = portal->http_rate.throttled;
+    stats->http_conn_throttled = portal->http_rate.conn_throttled;
+    stats->header_bytes_dropped = portal->header_bytes_dropped;
+    stats->conn_evicted_new = portal->conn_evicted[CONN_NEW];
+    stats->conn_evicted_probe = portal->conn_evicted[CONN_PROBE];
+    stats->conn_evicted_page = portal->conn_evicted[CONN_PAGE];
+    stats->conn_idle_closed = portal->conn_idle_closed;
+    stats->probe_closed = portal->probe_closed;
+    return ESP_OK;
+}
@@ -1,7 +1,12 @@
 #pragma once
 
 #include "esp_http_server.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -17,6 +22,31 @@ typedef enum {
     CAPTIVE_HANDLER_DELETE
 } captive_handler_method_t;
 
+// Максимальная длина URI пользовательского обработчика (с завершающим нулём)
+#define CAPTIVE_PORTAL_HANDLER_URI_LEN 64
+
+// Количество клиентов, отслеживаемых ограничением частоты запросов
+#define CAPTIVE_PORTAL_RATE_TABLE_SIZE 16
+
+// Максимум одновременно открытых HTTP соединений
+#define CAPTIVE_PORTAL_MAX_SOCKETS 16
+
+// Фильтр заголовков: максимальная длина имени и число дополнительных заголовков
+#define CAPTIVE_PORTAL_HEADER_NAME_LEN 32
+#define CAPTIVE_PORTAL_MAX_KEPT_HEADERS 8
+
+// Манифест веб-файлов: максимум записей и длина имени (как CONFIG_SPIFFS_OBJ_NAME_LEN)
+#define CAPTIVE_PORTAL_MAX_ASSETS 8
+#define CAPTIVE_PORTAL_ASSET_PATH_LEN 32
+
+// Размер стека DNS задачи по умолчанию (байты)
+#define CAPTIVE_PORTAL_DNS_STACK_SIZE 4096
+
+// Минимальный стек DNS задачи (байты): буфер пакета 512 байт,
+// recvfrom/sendto lwip и ESP_LOG. Меньший стек в статическом режиме
+// отклоняется, в обычном - увеличивается до минимума.
+#define CAPTIVE_PORTAL_DNS_STACK_MIN 2560
+
 // Конфигурация (из вашего рабочего кода)
 typedef struct {
     char ap_ssid[32];
@@ -25,11 +55,127 @@ typedef struct {
     bool ap_hidden;
     uint16_t http_port;
     char web_root_path[32];
+
+    // Размеры задач и сокетов, 0 = значение по умолчанию
+    uint32_t dns_task_stack_size;   // байты, по умолчанию CAPTIVE_PORTAL_DNS_STACK_SIZE
+    uint32_t httpd_stack_size;      // байты, по умолчанию 4096
+    uint16_t max_open_sockets;      // по умолчанию 7
+
+    // Быстрый старт: DNS запускается до HTTP сервера,
+    // SPIFFS монтируется при первом запросе статического файла
+    bool fast_start;
+
+    // Ограничение частоты запросов с одного IP (token bucket).
+    // *_rate_limit - запросов в секунду, 0 = без ограничения;
+    // *_rate_burst - допустимый всплеск, 0 = равен rate_limit.
+    uint16_t dns_rate_limit;
+    uint16_t dns_rate_burst;
+    uint16_t http_rate_limit;
+    uint16_t http_rate_burst;
+
+    // Отключить фильтр заголовков. Тогда httpd получает все заголовки
+    // и CONFIG_HTTPD_MAX_REQ_HDR_LEN нужно увеличить до 1024-2048.
+    bool keep_all_headers;
+
+    // Менеджер соединений, 0 = значение по умолчанию
+    uint8_t http_timeout_s;             // таймаут recv/send, по умолчанию 5
+    uint8_t http_page_sockets;          // сокеты, зарезервированные под страницу, по умолчанию 2
+    uint16_t http_keepalive_idle_ms;    // простой keep-alive страницы, по умолчанию 2000
+    bool http_lru_only;                 // отключить менеджер: только LRU httpd (для сравнения)
 } captive_portal_config_t;
 
+// Непрозрачная память под портал для статического режима.
+// Размер проверяется при компиляции библиотеки (_Static_assert):
+// на ESP32 структура занимает 1704 байта, запас - 8 байт. Слагаемое
+// с sizeof(void *) учитывает указатели при сборке на 64-битном хосте.
+#define CAPTIVE_PORTAL_STORAGE_WORDS (202 + 3 * sizeof(void *))
+
+typedef struct {
+    uint64_t dummy[CAPTIVE_PORTAL_STORAGE_WORDS];
+} captive_portal_storage_t;
+
+// Непрозрачный слот арены пользовательских обработчиков
+typedef struct {
+    char dummy_uri[CAPTIVE_PORTAL_HANDLER_URI_LEN];
+    int dummy_method;
+    void *dummy_ptr[2];
+} captive_handler_slot_t;
+
+// Непрозрачный слот пула состояний фильтра заголовков
+typedef struct {
+    void *dummy_ptr;
+    uint32_t dummy[52];
+} captive_header_filter_slot_t;
+
+// Память, предоставляемая вызывающим кодом (статический режим).
+// Все буферы должны жить дольше портала; библиотека их не освобождает.
+typedef struct {
+    captive_portal_storage_t *portal;       // память под структуру портала
+    captive_handler_slot_t *handler_slots;  // арена пользовательских обработчиков
+    size_t handler_slot_count;              // количество слотов в арене
+    StackType_t *dns_task_stack;            // стек DNS задачи
+    uint32_t dns_task_stack_size;           // байты, не меньше CAPTIVE_PORTAL_DNS_STACK_MIN
+    StaticTask_t *dns_task_tcb;             // TCB DNS задачи
+    StaticSemaphore_t *mutex_buffer;        // буфер мьютекса
+    captive_header_filter_slot_t *header_filter_slots;  // пул фильтра заголовков
+    size_t header_filter_slot_count;        // не меньше max_open_sockets (если фильтр включён)
+} captive_portal_static_storage_t;
+
+// Отчёт о потреблении памяти.
+// *_free_min - минимальный остаток стека (high-water mark) в байтах,
+// 0 если задача ещё не запускалась или не обработала ни одного запроса.
+typedef struct {
+    bool static_alloc;              // портал создан через captive_portal_init_static
+    size_t portal_bytes;            // структура портала
+    size_t handler_bytes;           // память под пользовательские обработчики
+    size_t handler_count;           // зарегистрировано обработчиков
+    size_t handler_capacity;        // слотов в арене (0 = куча, без ограничения)
+    size_t dns_stack_bytes;         // размер стека DNS задачи
+    size_t dns_stack_free_min;      // high-water mark DNS задачи
+    size_t httpd_stack_bytes;       // размер стека задачи httpd
+    size_t httpd_stack_free_min;    // high-water mark задачи httpd
+    size_t httpd_heap_bytes;        // куча, занятая httpd_start (измерено)
+    size_t httpd_open_sockets;      // max_open_sockets сервера
+    size_t header_filter_bytes;     // состояние фильтра заголовков на все сокеты (в куче -
+                                    // пик при занятых сокетах, не входит в httpd_heap_bytes)
+    size_t start_heap_bytes;        // куча, занятая captive_portal_start целиком (измерено)
+} captive_portal_footprint_t;
+
+// Замеры времени запуска (esp_timer, микросекунды).
+// *_us фаз - длительность фазы, first_* - время от загрузки до события, 0 = ещё не было.
+typedef struct {
+    int64_t start_us;               // момент вызова captive_portal_start от загрузки
+    int64_t spiffs_us;              // монтирование SPIFFS (при быстром старте - отложенное)
+    int64_t netif_us;               // создание netif и настройка IP/DHCP
+    int64_t wifi_us;                // настройка и запуск Wi-Fi
+    int64_t httpd_us;               // запуск HTTP сервера, включая повторы
+    int64_t dns_us;                 // запуск DNS задачи
+    int64_t total_us;               // captive_portal_start целиком
+    int64_t first_dns_us;           // первый ответ DNS от загрузки
+    int64_t first_probe_us;         // первый ответ на проверку captive portal от загрузки
+} captive_portal_timing_t;
+
+// Статистика работы портала
+typedef struct {
+    uint32_t dns_throttled;         // DNS запросов отброшено по лимиту
+    uint32_t http_throttled;        // HTTP запросов отклонено с кодом 429
+    uint32_t http_conn_throttled;   // HTTP соединений закрыто сразу после accept
+    uint32_t header_bytes_dropped;  // байт заголовков отброшено фильтром
+    uint32_t conn_evicted_new;      // вытеснено соединений без запросов
+    uint32_t conn_evicted_probe;    // вытеснено соединений проверок captive portal
+    uint32_t conn_evicted_page;     // вытеснено соединений страницы
+    uint32_t conn_idle_closed;      // закрыто соединений страницы по простою
+    uint32_t probe_closed;          // закрыто соединений после ответа на проверку
+} captive_portal_stats_t;
+
 // Инициализация
 captive_portal_t* captive_portal_init(const captive_portal_config_t *config);
 
+// Инициализация без динамического выделения памяти портала:
+// память портала, стек DNS задачи и арена обработчиков берутся из storage
+captive_portal_t* captive_portal_init_static(const captive_portal_config_t *config,
+                                             const captive_portal_static_storage_t *storage);
+
 // Запуск/остановка
 esp_err_t captive_portal_start(captive_portal_t *portal);
 esp_err_t captive_portal_stop(captive_portal_t *portal);
@@ -41,9 +187,27 @@ esp_err_t captive_portal_add_handler(captive_portal_t *portal,
                                      captive_handler_method_t method,
                                      captive_handler_t handler);
 
+// Заголовок, который нужен пользовательскому обработчику.
+// Без регистрации фильтр пропускает только Host, User-Agent,
+// Content-Length, Content-Type, Transfer-Encoding и Connection.
+// Вызывать до captive_portal_start.
+esp_err_t captive_portal_keep_header(captive_portal_t *portal, const char *name);
+
 // Утилиты
 bool captive_portal_is_running(captive_portal_t *portal);
 
+// Отчёт о потреблении памяти (стеки задач, куча по подсистемам)
+esp_err_t captive_portal_get_footprint(captive_portal_t *portal,
+                                       captive_portal_footprint_t *footprint);
+
+// Длительность фаз запуска и время до первых ответов
+esp_err_t captive_portal_get_timing(captive_portal_t *portal,
+                                    captive_portal_timing_t *timing);
+
+// Счётчики ограничения частоты запросов
+esp_err_t captive_portal_get_stats(captive_portal_t *portal,
+                                   captive_portal_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
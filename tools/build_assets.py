@@ -0,0 +1,244 @@
+#!/usr/bin/env python3
+# Сборка веб-файлов портала: минификация HTML/CSS, встраивание мелких
+# CSS/JS в HTML и имена с хешем содержимого + манифест для портала.
+#
+#   python tools/build_assets.py data data_dist
+#
+# Результат (data_dist) заливается в SPIFFS вместо data/.
+
+import argparse
+import hashlib
+import os
+import re
+import shutil
+import sys
+
+MANIFEST_NAME = "asset-manifest.txt"
+HASH_LEN = 8
+
+# Имя файла в SPIFFS ограничено CONFIG_SPIFFS_OBJ_NAME_LEN (32 с путём)
+SPIFFS_NAME_MAX = 31
+
+TEXT_EXTENSIONS = (".html", ".htm", ".css", ".js", ".json", ".svg", ".txt")
+HTML_EXTENSIONS = (".html", ".htm")
+
+# Блоки, внутри которых пробелы значимы или обрабатываются отдельно
+RAW_BLOCK_RE = re.compile(r"(<(script|style|pre|textarea)\b[^>]*>)(.*?)(</\2\s*>)",
+                          re.IGNORECASE | re.DOTALL)
+LINK_CSS_RE = re.compile(r"<link\b[^>]*\brel=[\"']?stylesheet[\"']?[^>]*>", re.IGNORECASE)
+SCRIPT_SRC_RE = re.compile(r"<script\b([^>]*)\bsrc=[\"']([^\"']+)[\"']([^>]*)>\s*</script\s*>",
+                           re.IGNORECASE)
+HREF_RE = re.compile(r"\bhref=[\"']([^\"']+)[\"']", re.IGNORECASE)
+ATTR_URL_RE = re.compile(r"\b(href|src)=([\"'])([^\"']+)\2", re.IGNORECASE)
+CSS_URL_RE = re.compile(r"url\(\s*([\"']?)([^\"')]+)\1\s*\)")
+
+# Теги, пробелы рядом с которыми не влияют на отображение
+BLOCK_TAGS = ("html", "head", "body", "title", "meta", "link", "base", "style", "script",
+              "div", "p", "header", "footer", "main", "section", "article", "aside", "nav",
+              "h1", "h2", "h3", "h4", "h5", "h6", "ul", "ol", "li", "dl", "dt", "dd",
+              "table", "thead", "tbody", "tfoot", "tr", "td", "th", "form", "fieldset",
+              "hr", "br", "pre", "blockquote", "figure", "figcaption", "noscript")
+BLOCK_TAG_RE = re.compile(r"\s*(<!DOCTYPE[^>]*>|</?(?:%s)\b[^>]*>)\s*" % "|".join(BLOCK_TAGS),
+                          re.IGNORECASE)
+
+
+# Комментарии и строки CSS: строки копируются без изменений
+CSS_TOKEN_RE = re.compile(r"/\*.*?\*/|\"(?:\\.|[^\"\\])*\"|'(?:\\.|[^'\\])*'", re.DOTALL)
+
+
+def minify_css_code(text):
+    text = re.sub(r"\s+", " ", text)
+    # Пробел перед ':' в селекторах значим (div :first-child), после - нет
+    text = re.sub(r"\s*([{};,])\s*", r"\1", text)
+    text = re.sub(r":\s+", ":", text)
+    return text.replace(";}", "}")
+
+
+def minify_css(text):
+    parts = []
+    pos = 0
+    for match in CSS_TOKEN_RE.finditer(text):
+        parts.append(minify_css_code(text[pos:match.start()]))
+        if not match.group(0).startswith("/*"):
+            parts.append(match.group(0))
+        pos = match.end()
+    parts.append(minify_css_code(text[pos:]))
+    return "".join(parts).strip()
+
+
+# JS не минифицируется: без полного разбора нельзя отличить строки,
+# шаблоны и регулярные выражения от кода, а менять поведение страницы нельзя.
+
+
+def minify_html(text):
+    blocks = []
+
+    def stash(match):
+        open_tag, tag, body, close_tag = match.groups()
+        tag = tag.lower()
+        if tag == "style":
+            body = minify_css(body)
+        blocks.append(open_tag + body + close_tag)
+        return "\x00%d\x00" % (len(blocks) - 1)
+
+    text = RAW_BLOCK_RE.sub(stash, text)
+    text = re.sub(r"<!--(?!\[if).*?-->", "", text, flags=re.DOTALL)
+    # Пробелы между строчными элементами значимы (<b>a</b> <i>b</i>):
+    # схлопываем до одного и убираем только рядом с блочными тегами
+    text = re.sub(r"\s+", " ", text)
+    text = BLOCK_TAG_RE.sub(r"\1", text)
+    text = re.sub(r"\x00(\d+)\x00", lambda m: blocks[int(m.group(1))], text)
+    return text.strip()
+
+
+def minify(name, data):
+    ext = os.path.splitext(name)[1].lower()
+    if ext not in TEXT_EXTENSIONS:
+        return data
+    text = data.decode("utf-8")
+    if ext == ".css":
+        text = minify_css(text)
+    elif ext in HTML_EXTENSIONS:
+        text = minify_html(text)
+    return text.encode("utf-8")
+
+
+def fingerprint(rel_path, data):
+    base, ext = os.path.splitext(rel_path)
+    digest = hashlib.sha256(data).hexdigest()[:HASH_LEN]
+    return "%s.%s%s" % (base, digest, ext)
+
+
+def local_path(url, html_dir):
+    # Только локальные ссылки без схемы, query и fragment
+    if re.match(r"^[a-z]+:|^//", url, re.IGNORECASE) or url.startswith("#"):
+        return None
+    url = url.split("?", 1)[0].split("#", 1)[0]
+    if url.startswith("/"):
+        return url.lstrip("/")
+    return os.path.normpath(os.path.join(html_dir, url)).replace(os.sep, "/")
+
+
+def collect(src_dir):
+    files = {}
+    for root, _, names in os.walk(src_dir):
+        for name in sorted(names):
+            path = os.path.join(root, name)
+            rel = os.path.relpath(path, src_dir).replace(os.sep, "/")
+            with open(path, "rb") as f:
+                files[rel] = minify(rel, f.read())
+    return files
+
+
+def build(src_dir, out_dir, inline_limit):
+    files = collect(src_dir)
+    html_files = [p for p in files if p.lower().endswith(HTML_EXTENSIONS)]
+    inlined = set()
+
+    # Встраиваем мелкие CSS/JS прямо в HTML
+    for html in html_files:
+        html_dir = os.path.dirname(html)
+        text = files[html].decode("utf-8")
+
+        def inline_css(match):
+            href = HREF_RE.search(match.group(0))
+            path = href and local_path(href.group(1), html_dir)
+            if path in files and len(files[path]) <= inline_limit:
+                inlined.add(path)
+                return "<style>%s</style>" % files[path].decode("utf-8")
+            return match.group(0)
+
+        def inline_js(match):
+            path = local_path(match.group(2), html_dir)
+            if path in files and len(files[path]) <= inline_limit:
+                inlined.add(path)
+                return "<script%s%s>%s</script>" % (match.group(1).rstrip(),
+                                                    match.group(3),
+                                                    files[path].decode("utf-8"))
+            return match.group(0)
+
+        text = LINK_CSS_RE.sub(inline_css, text)
+        text = SCRIPT_SRC_RE.sub(inline_js, text)
+        files[html] = text.encode("utf-8")
+
+    # Файлы, на которые больше никто не ссылается, не попадают в образ
+    for path in inlined:
+        still_used = any(path in files[h].decode("utf-8") for h in html_files)
+        if not still_used:
+            del files[path]
+
+    # HTML - точки входа, их имена не меняются; остальное получает хеш.
+    # CSS может ссылаться на картинки, поэтому сначала все не-CSS файлы.
+    renamed = {}
+    order = sorted((p for p in files if p not in html_files),
+                   key=lambda p: p.lower().endswith(".css"))
+    for path in order:
+        if path.lower().endswith(".css"):
+            css_dir = os.path.dirname(path)
+            text = files[path].decode("utf-8")
+            text = CSS_URL_RE.sub(
+                lambda m: "url(%s)" % ("/" + renamed[local_path(m.group(2), css_dir)]
+                                       if local_path(m.group(2), css_dir) in renamed
+                                       else m.group(2)), text)
+            files[path] = text.encode("utf-8")
+        renamed[path] = fingerprint(path, files[path])
+
+    for html in html_files:
+        html_dir = os.path.dirname(html)
+        text = files[html].decode("utf-8")
+
+        def rewrite(match):
+            path = local_path(match.group(3), html_dir)
+            if path in renamed:
+                return '%s=%s/%s%s' % (match.group(1), match.group(2), renamed[path],
+                                       match.group(2))
+            return match.group(0)
+
+        files[html] = ATTR_URL_RE.sub(rewrite, text).encode("utf-8")
+
+    # Запись результата
+    if os.path.isdir(out_dir):
+        shutil.rmtree(out_dir)
+    os.makedirs(out_dir)
+
+    manifest = []
+    for path, data in sorted(files.items()):
+        physical = renamed.get(path, path)
+        if len("/" + physical) > SPIFFS_NAME_MAX:
+            sys.exit("error: %s is too long for SPIFFS (%d > %d)" %
+                     (physical, len(physical) + 1, SPIFFS_NAME_MAX))
+        target = os.path.join(out_dir, physical)
+        os.makedirs(os.path.dirname(target), exist_ok=True)
+        with open(target, "wb") as f:
+            f.write(data)
+        manifest.append("/%s /%s" % (path, physical))
+
+    with open(os.path.join(out_dir, MANIFEST_NAME), "w", newline="\n") as f:
+        f.write("# logical physical\n")
+        f.write("\n".join(manifest) + "\n")
+
+    return files, renamed
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build captive portal web assets")
+    parser.add_argument("src", nargs="?", default="data", help="source directory (default: data)")
+    parser.add_argument("out", nargs="?", default="data_dist",
+                        help="output directory for the SPIFFS image (default: data_dist)")
+    parser.add_argument("--inline-limit", type=int, default=2048,
+                        help="inline CSS/JS files up to this many bytes (default: 2048)")
+    args = parser.parse_args()
+
+    src_size = sum(os.path.getsize(os.path.join(r, n))
+                   for r, _, names in os.walk(args.src) for n in names)
+    files, renamed = build(args.src, args.out, args.inline_limit)
+    out_size = sum(len(d) for d in files.values())
+
+    for path in sorted(files):
+        print("  /%-24s -> /%s (%d bytes)" % (path, renamed.get(path, path), len(files[path])))
+    print("%d -> %d bytes, manifest: %s" % (src_size, out_size,
+                                            os.path.join(args.out, MANIFEST_NAME)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+# Нагрузочная проверка HTTP сервера портала с компьютера, подключённого к AP.
+# Каждый раунд: всплеск проверок captive portal (каждая на новом
+# соединении), простаивающие соединения без запросов и загрузки
+# страницы (/ и её файлы по одному keep-alive соединению).
+#
+#   python tools/http_bench.py policy=192.168.4.1 lru=192.168.4.1:8080
+#
+# Цели с метками выводятся рядом, например прошивки с менеджером
+# соединений и с config.http_lru_only = true.
+
+import argparse
+import http.client
+import math
+import re
+import socket
+import threading
+import time
+
+PROBE_PATHS = ("/generate_204", "/gen_204", "/hotspot-detect.html",
+               "/connecttest.txt", "/ncsi.txt", "/success.txt")
+
+# Локальные файлы, на которые ссылается страница
+ASSET_RE = re.compile(r"\b(?:href|src)=[\"'](/?[^\"':?#]+)[\"']", re.IGNORECASE)
+
+
+def percentile(values, p):
+    # Ближайший ранг: значение, не меньше которого p% выборки
+    if not values:
+        return None
+    ordered = sorted(values)
+    rank = max(0, math.ceil(p / 100.0 * len(ordered)) - 1)
+    return ordered[rank]
+
+
+class Results:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.probe_ms = []
+        self.page_ms = []
+        self.asset_ms = []
+        self.errors = 0
+
+    def add(self, name, value):
+        with self.lock:
+            getattr(self, name).append(value)
+
+    def error(self):
+        with self.lock:
+            self.errors += 1
+
+
+def fetch(conn, path):
+    conn.request("GET", path, headers={"User-Agent": "captive-portal-bench"})
+    resp = conn.getresponse()
+    body = resp.read()
+    if resp.status >= 400:
+        raise http.client.HTTPException("%s: HTTP %d" % (path, resp.status))
+    return body
+
+
+def run_probe(host, port, timeout, path, results):
+    start = time.monotonic()
+    conn = http.client.HTTPConnection(host, port, timeout=timeout)
+    try:
+        fetch(conn, path)
+        results.add("probe_ms", (time.monotonic() - start) * 1000)
+    except (OSError, http.client.HTTPException):
+        results.error()
+    finally:
+        conn.close()
+
+
+def run_page(host, port, timeout, results):
+    start = time.monotonic()
+    conn = http.client.HTTPConnection(host, port, timeout=timeout)
+    try:
+        html = fetch(conn, "/").decode("utf-8", "replace")
+        assets = sorted(set("/" + p.lstrip("/") for p in ASSET_RE.findall(html)))
+        for path in assets:
+            asset_start = time.monotonic()
+            try:
+                fetch(conn, path)
+            except (http.client.RemoteDisconnected, ConnectionError):
+                # Сервер закрыл keep-alive - дозагружаем по новому соединению
+                conn.close()
+                conn = http.client.HTTPConnection(host, port, timeout=timeout)
+                fetch(conn, path)
+            results.add("asset_ms", (time.monotonic() - asset_start) * 1000)
+        results.add("page_ms", (time.monotonic() - start) * 1000)
+    except (OSError, http.client.HTTPException):
+        results.error()
+    finally:
+        conn.close()
+
+
+def open_idle(host, port, timeout, sockets):
+    try:
+        sockets.append(socket.create_connection((host, port), timeout=timeout))
+    except OSError:
+        pass
+
+
+def run_target(host, port, args):
+    results = Results()
+    for _ in range(args.rounds):
+        idle = []
+        for _ in range(args.idle):
+            open_idle(host, port, args.timeout, idle)
+
+        threads = [threading.Thread(target=run_probe,
+                                    args=(host, port, args.timeout,
+                                          PROBE_PATHS[i % len(PROBE_PATHS)], results))
+                   for i in range(args.probes)]
+        threads += [threading.Thread(target=run_page, args=(host, port, args.timeout, results))
+                    for _ in range(args.pages)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+
+        for s in idle:
+            s.close()
+        time.sleep(args.pause)
+    return results
+
+
+def parse_target(text):
+    label, _, addr = text.rpartition("=")
+    host, _, port = addr.partition(":")
+    return label or addr, host, int(port or 80)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Load test the captive portal HTTP server")
+    parser.add_argument("targets", nargs="+", metavar="[LABEL=]HOST[:PORT]",
+                        help="portal address, e.g. policy=192.168.4.1")
+    parser.add_argument("--rounds", type=int, default=20, help="bursts per target (default: 20)")
+    parser.add_argument("--probes", type=int, default=12,
+                        help="probe requests per burst, one connection each (default: 12)")
+    parser.add_argument("--pages", type=int, default=2,
+                        help="page loads per burst (default: 2)")
+    parser.add_argument("--idle", type=int, default=2,
+                        help="idle connections opened before each burst (default: 2)")
+    parser.add_argument("--pause", type=float, default=1.0,
+                        help="seconds between bursts (default: 1.0)")
+    parser.add_argument("--timeout", type=float, default=10.0,
+                        help="socket timeout in seconds (default: 10)")
+    args = parser.parse_args()
+
+    print("%-10s %-6s %6s %8s %8s %8s" % ("target", "kind", "count", "p50 ms", "p95 ms", "p99 ms"))
+    for label, host, port in map(parse_target, args.targets):
+        results = run_target(host, port, args)
+        for kind in ("probe", "page", "asset"):
+            values = getattr(results, kind + "_ms")
+            stats = [percentile(values, p) for p in (50, 95, 99)]
+            print("%-10s %-6s %6d %s" % (label, kind, len(values),
+                                         " ".join("%8.1f" % v if v is not None else "%8s" % "-"
+                                                  for v in stats)))
+        print("%-10s errors %6d" % (label, results.errors))
+
+
+if __name__ == "__main__":
+    main()